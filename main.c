@@ -1,3 +1,4 @@
+#define _GNU_SOURCE    // copy_file_range(), memfd_create()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,17 @@
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 
 // Globals for sendMail() and checkMail() functions
 // Used to store messages when terminal is blocked for input
@@ -63,6 +75,95 @@ struct sigaction SIGCHLD_action = {0};     // SIGCHLD sigaction (goes unused in
 */
 // =====
 
+// Globals Re: filename (glob) expansion
+// -----
+#define GLOB_DENTS_SIZE (256 * 1024)       // Bytes of directory entries requested
+                                           // per getdents64() call
+
+char *globSortArena = NULL;                // qsort() has no context argument, so
+                                           // compareGlobOffsets() reads the arena here
+// =====
+
+// Globals Re: `cached` command result cache
+// (for `cachestats` command)
+// -----
+#define CACHE_DEFAULT_MAX (64LL * 1024 * 1024)  // Size cap when SMALLSH_CACHE_MAX isn't set
+#define CACHE_DEFAULT_ENV "LANG:LC_ALL:TZ"      // Variables keyed when SMALLSH_CACHE_ENV isn't set
+#define CACHE_TMP_MAX_AGE (60 * 60)             // Seconds before a leftover `.tmp.<pid>` file
+                                                // is assumed to belong to a dead shell
+
+int cacheHits = 0;             // Replayed from the cache
+int cacheMisses = 0;           // Had to actually run the command
+int cacheEvictions = 0;        // Entries dropped to stay under the cap
+// =====
+
+// Growable view of a here-document's memfd. The body is
+// written straight into the mapping, so lines are copied
+// once and never touch the disk.
+struct hereBuffer {
+    int fd;
+    char *map;
+    size_t len;
+    size_t cap;
+};
+
+// Everything a `cached` result depends on, laid out as
+// length-prefixed fields. The file name is only a hash of
+// this; the full bytes are stored next to the exit status
+// and compared on every hit, so a hash collision can't
+// replay somebody else's output.
+struct cacheKey {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// Record layout returned by the raw getdents64 syscall
+// (see `man 2 getdents`)
+struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One compiled glob element. Each one consumes exactly
+// one character of a filename, except GLOB_STAR.
+enum { GLOB_CHAR, GLOB_ANY, GLOB_STAR, GLOB_SET };
+
+struct globToken {
+    unsigned char type;
+    unsigned char ch;           // GLOB_CHAR: the literal character
+    unsigned char negate;       // GLOB_SET: `[!...]` or `[^...]`
+    unsigned char set[32];      // GLOB_SET: bitmap of accepted bytes
+};
+
+// One `/`-separated piece of a pattern, compiled once
+// before any directory is read.
+struct globComponent {
+    const char *text;           // Raw text (not NUL-terminated)
+    size_t len;
+    int isPattern;              // 0 == plain name, no directory scan needed
+    struct globToken *tokens;
+    int tokenCount;
+    size_t minLen;              // Shortest filename that could match
+    int hasStar;
+    int tailLen;                // Trailing GLOB_CHAR tokens, checked first
+};
+
+// Expanded arguments. Names are packed into a single arena
+// and referenced by offset so that growing the arena never
+// invalidates anything; pointers are only built at the end.
+struct globList {
+    char *arena;
+    size_t arenaLen;
+    size_t arenaCap;
+    size_t *offsets;
+    size_t count;
+    size_t cap;
+};
+
 void expandVar(char* input, char* buffer, pid_t pid){
     // Adapted from The Paramagnetic Croissant's answer to
     // "Replace all occurrences of a substring in a string in C"
@@ -347,7 +448,17 @@ void sigIntHandler(int sig) {
     // to return to default behavior
 }
 
-void runProgram(char **argv, int isBackground, char **pipes) {
+void setFailedStatus(){
+    // Records a command that never got to run (or whose
+    // output couldn't be delivered) the same way runProgram()
+    // records a foreground child that exited with status 1.
+    hasRunForegroundProc = 1;
+    last_exit_status = 1;
+    last_signal = -1;
+    exit_status = 1;
+}
+
+void runProgram(char **argv, int isBackground, char **pipes, int hereFD) {
     // Basic control flow Re: fork() adapted from `execute` function in
     // `shell.c` program via Michigan Tech CS 4411 course website
     // http://www.csl.mtu.edu/cs4411.ck/www/NOTES/process/fork/shell.c
@@ -395,6 +506,16 @@ void runProgram(char **argv, int isBackground, char **pipes) {
             }
 
 
+        }
+        if(hereFD != -1){
+            // `<<` or `<<<` was entered: the body is already
+            // sitting in a sealed memfd, so just make it stdin
+            isInputPiped = 1;
+            if(dup2(hereFD, STDIN_FILENO) == -1){
+                perror("Error! dup2() on here-document unsuccessful");
+                fflush(stderr);
+                exit(1);
+            }
         }
         if(strcmp(pipes[1], "") != 0){
             isOutputPiped = 1;
@@ -479,36 +600,68 @@ void runProgram(char **argv, int isBackground, char **pipes) {
     }
 }
 
-void parseArguments(char *input, char **argv, char **pipes){
+int parseArguments(char *input, char **argv, char **pipes){
     // Adapted from `parse` function in shell.c program
     // via Michigan Tech CS 4411 course website
     // http://www.csl.mtu.edu/cs4411.ck/www/NOTES/process/fork/shell.c
-    int isPipe = 0;
+    // Returns -1 if a redirection is missing its operand.
     while(*input != '\0') {
         while(*input == ' ' || *input == '\n') {
             *input++ = '\0'; // Null-terminating spaces between words
         }
-        isPipe = 0;
-        // Handling input/output piping:
-        if(input[0] == '<') {
-            char* inputSaveptr;
-            strtok_r(input, " ", &inputSaveptr);  // '<' will be tokenized first, no need to save it
-            // this is the actual path:
-            pipes[0] = strtok_r(NULL, " ", &inputSaveptr);
+        // Handling input/output piping. Redirections can come in
+        // any order (`cat > out <<EOF`), so keep going until the
+        // next word isn't one:
+        while(input[0] == '<' || input[0] == '>') {
+            char *pipeSaveptr;
+            char *operand;
+            int slot;
+            char *token = strtok_r(input, " ", &pipeSaveptr);
+            int operatorLen = 1;
+            if(strncmp(token, "<<<", 3) == 0) {
+                // `<<<word` / `<<< word` (here-string)
+                slot = 3;
+                operatorLen = 3;
+            } else if(strncmp(token, "<<", 2) == 0) {
+                // `<<EOF` / `<< EOF` (here-document)
+                slot = 2;
+                operatorLen = 2;
+            } else if(strncmp(token, ">>", 2) == 0) {
+                // Appending isn't supported, and truncating
+                // instead would quietly destroy the file
+                fprintf(stderr, "Error! `>>` is not supported\n");
+                fflush(stderr);
+                return -1;
+            } else {
+                // `<file` / `< file` or `>file` / `> file`
+                slot = (token[0] == '<') ? 0 : 1;
+            }
+            operand = token + operatorLen;
+            if(*operand == '\0'){
+                // Operand is the next word
+                operand = strtok_r(NULL, " ", &pipeSaveptr);
+            }
+            if(operand == NULL){
+                fprintf(stderr, "Error! Missing operand after `%s`\n", token);
+                fflush(stderr);
+                return -1;
+            }
+            if(slot != 1 && (strcmp(pipes[0], "") != 0 || strcmp(pipes[2], "") != 0
+                             || strcmp(pipes[3], "") != 0)){
+                // `<`, `<<` and `<<<` all want to be stdin
+                fprintf(stderr, "Error! Only one of `<`, `<<` and `<<<` may be used\n");
+                fflush(stderr);
+                return -1;
+            }
+            pipes[slot] = operand;
 
             // update `input` to match our point in the string:
-            input = inputSaveptr;
-            isPipe = 1;  // Set a flag so that we don't save
-                         // the piping commands as args
-        }
-        if(input[0] == '>'){
-            char *outputSaveptr;
-            strtok_r(input, " ", &outputSaveptr);  // '>', which we don't need
-            pipes[1] = strtok_r(NULL, " ", &outputSaveptr);
-            input = outputSaveptr;
-            isPipe = 1;
-        }
-        if(isPipe == 0){
+            input = pipeSaveptr;
+            while(*input == ' ' || *input == '\n') {
+                *input++ = '\0';
+            }
+        }
+        if(*input != '\0'){
             // If it's not a pipe, it's an argument, so save it!
             *argv++ = input;
         }
@@ -517,6 +670,1001 @@ void parseArguments(char *input, char **argv, char **pipes){
         }
     }
     *argv = (char *) NULL;  // End with a null pointer
+    return 0;
+}
+
+void globListAppend(struct globList *list, const char *str, size_t len){
+    // Copy `str` into the arena and remember where it went.
+    // Both arrays grow geometrically so huge directories stay linear.
+    while(list->arenaLen + len + 1 > list->arenaCap){
+        list->arenaCap = list->arenaCap ? list->arenaCap * 2 : 4096;
+        list->arena = realloc(list->arena, list->arenaCap);
+    }
+    if(list->count == list->cap){
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->offsets = realloc(list->offsets, list->cap * sizeof(size_t));
+    }
+    memcpy(list->arena + list->arenaLen, str, len);
+    list->arena[list->arenaLen + len] = '\0';
+    list->offsets[list->count++] = list->arenaLen;
+    list->arenaLen += len + 1;
+}
+
+void freeGlobList(struct globList *list){
+    free(list->arena);
+    free(list->offsets);
+    memset(list, 0, sizeof(*list));
+}
+
+int compareGlobOffsets(const void *a, const void *b){
+    // qsort() comparator for offsets into globSortArena
+    return strcmp(globSortArena + *(const size_t *)a,
+                  globSortArena + *(const size_t *)b);
+}
+
+int compileGlob(const char *pat, size_t len, struct globToken *tokens){
+    // Turns one pattern component into a token array so that
+    // matching an entry never has to re-parse `[...]` sets.
+    // Returns the number of tokens written (at most `len`).
+    int count = 0;
+    size_t i = 0;
+    while(i < len){
+        struct globToken *tok = &tokens[count];
+        memset(tok, 0, sizeof(*tok));
+        if(pat[i] == '*'){
+            // Collapse `**` into a single star
+            if(count == 0 || tokens[count-1].type != GLOB_STAR){
+                tok->type = GLOB_STAR;
+                count++;
+            }
+            i++;
+            continue;
+        }
+        if(pat[i] == '?'){
+            tok->type = GLOB_ANY;
+            count++;
+            i++;
+            continue;
+        }
+        if(pat[i] == '['){
+            size_t j = i + 1;
+            if(j < len && (pat[j] == '!' || pat[j] == '^')){
+                tok->negate = 1;
+                j++;
+            }
+            size_t first = j;
+            // A `]` right after the opening bracket is a literal member
+            while(j < len && (pat[j] != ']' || j == first)){
+                unsigned char lo = pat[j];
+                unsigned char hi = lo;
+                if(j + 2 < len && pat[j+1] == '-' && pat[j+2] != ']'){
+                    hi = pat[j+2];
+                    j += 2;
+                }
+                for(unsigned int c = lo; c <= hi; c++){
+                    tok->set[c >> 3] |= 1 << (c & 7);
+                }
+                j++;
+            }
+            if(j < len){
+                // Found the closing `]`
+                tok->type = GLOB_SET;
+                count++;
+                i = j + 1;
+                continue;
+            }
+            // No closing `]`, so the `[` is just a character
+            memset(tok, 0, sizeof(*tok));
+        }
+        tok->type = GLOB_CHAR;
+        tok->ch = pat[i++];
+        count++;
+    }
+    return count;
+}
+
+int globTokenMatches(const struct globToken *tok, unsigned char c){
+    switch(tok->type){
+        case GLOB_CHAR:
+            return tok->ch == c;
+        case GLOB_ANY:
+            return 1;
+        case GLOB_SET:
+            return ((tok->set[c >> 3] >> (c & 7)) & 1) != tok->negate;
+    }
+    return 0;
+}
+
+int globMatch(const struct globComponent *comp, const char *name, size_t nameLen){
+    // Matches a filename against a compiled component.
+    // Every non-star token consumes one character, so a single
+    // backtrack point (the last star seen) is all we need.
+    const struct globToken *tokens = comp->tokens;
+    int n = comp->tokenCount;
+
+    // Cheap rejections before the real match
+    if(nameLen < comp->minLen || (!comp->hasStar && nameLen != comp->minLen)){
+        return 0;
+    }
+    for(int i = 1; i <= comp->tailLen; i++){
+        if((unsigned char)name[nameLen-i] != tokens[n-i].ch){
+            return 0;
+        }
+    }
+
+    int t = 0;
+    size_t s = 0;
+    int starT = -1;
+    size_t starS = 0;
+    while(s < nameLen){
+        if(t < n && tokens[t].type == GLOB_STAR){
+            starT = ++t;
+            starS = s;
+        } else if(t < n && globTokenMatches(&tokens[t], name[s])){
+            t++;
+            s++;
+        } else if(starT != -1){
+            // Let the last star swallow one more character
+            t = starT;
+            s = ++starS;
+        } else {
+            return 0;
+        }
+    }
+    while(t < n && tokens[t].type == GLOB_STAR){
+        t++;
+    }
+    return t == n;
+}
+
+void globWalk(struct globList *list, struct globComponent *comps, int compCount,
+              int index, int trailingSlash, char *path, size_t pathLen, int needsCheck){
+    // Expands comps[index..] underneath `path`, which is either
+    // empty (current directory) or ends with `/`.
+    if(index == compCount){
+        // Names read out of a directory are known to exist, but
+        // a plain component on the end still has to be checked
+        struct stat st;
+        if(needsCheck && lstat(path, &st) != 0){
+            return;
+        }
+        globListAppend(list, path, pathLen);
+        return;
+    }
+
+    struct globComponent *comp = &comps[index];
+    int isLast = (index == compCount - 1);
+    int addSlash = !isLast || trailingSlash;
+
+    if(!comp->isPattern){
+        // Nothing to match, just extend the path
+        if(pathLen + comp->len + 2 > PATH_MAX){
+            return;
+        }
+        memcpy(path + pathLen, comp->text, comp->len);
+        size_t newLen = pathLen + comp->len;
+        if(addSlash){
+            path[newLen++] = '/';
+        }
+        path[newLen] = '\0';
+        globWalk(list, comps, compCount, index + 1, trailingSlash, path, newLen, 1);
+        return;
+    }
+
+    int dirFD = open(pathLen == 0 ? "." : path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFD == -1){
+        return;  // Unreadable or not a directory: no matches here
+    }
+
+    // Read entries in large batches instead of one
+    // readdir() call (and one libc buffer refill) at a time
+    char *dents = malloc(GLOB_DENTS_SIZE);
+    long nread;
+    while((nread = syscall(SYS_getdents64, dirFD, dents, GLOB_DENTS_SIZE)) > 0){
+        for(long off = 0; off < nread;){
+            struct linuxDirent64 *d = (struct linuxDirent64 *)(dents + off);
+            off += d->d_reclen;
+
+            const char *name = d->d_name;
+            if(name[0] == '.'){
+                // `.` and `..` are never matched, and other
+                // hidden files only by a pattern starting with `.`
+                if(name[1] == '\0' || (name[1] == '.' && name[2] == '\0')){
+                    continue;
+                }
+                if(comp->tokens[0].type != GLOB_CHAR || comp->tokens[0].ch != '.'){
+                    continue;
+                }
+            }
+
+            size_t nameLen = strlen(name);
+            if(!globMatch(comp, name, nameLen)){
+                continue;
+            }
+
+            if(addSlash && d->d_type != DT_DIR){
+                // We're about to descend, so this has to be a directory.
+                // Only symlinks and filesystems without d_type need a stat.
+                struct stat st;
+                if(d->d_type != DT_LNK && d->d_type != DT_UNKNOWN){
+                    continue;
+                }
+                if(fstatat(dirFD, name, &st, 0) != 0 || !S_ISDIR(st.st_mode)){
+                    continue;
+                }
+            }
+
+            if(pathLen + nameLen + 2 > PATH_MAX){
+                continue;
+            }
+            memcpy(path + pathLen, name, nameLen);
+            size_t newLen = pathLen + nameLen;
+            if(addSlash){
+                path[newLen++] = '/';
+            }
+            path[newLen] = '\0';
+            globWalk(list, comps, compCount, index + 1, trailingSlash, path, newLen, 0);
+        }
+    }
+    free(dents);
+    close(dirFD);
+}
+
+void expandGlobWord(struct globList *list, char *word){
+    // Splits `word` on `/`, compiles each component once
+    // and walks the directory tree adding every match to `list`.
+    size_t wordLen = strlen(word);
+    char path[PATH_MAX];
+    size_t pathLen = 0;
+
+    const char *p = word;
+    if(*p == '/'){
+        path[pathLen++] = '/';
+        while(*p == '/'){
+            p++;
+        }
+    }
+    path[pathLen] = '\0';
+
+    // No component can need more tokens than it has characters
+    struct globToken *tokens = malloc((wordLen + 1) * sizeof(struct globToken));
+    struct globComponent *comps = malloc((wordLen / 2 + 2) * sizeof(struct globComponent));
+    int compCount = 0;
+    int tokenCount = 0;
+    int trailingSlash = 0;
+
+    while(*p != '\0'){
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        struct globComponent *comp = &comps[compCount++];
+        memset(comp, 0, sizeof(*comp));
+        comp->text = p;
+        comp->len = len;
+        comp->tokens = &tokens[tokenCount];
+        comp->tokenCount = compileGlob(p, len, comp->tokens);
+        tokenCount += comp->tokenCount;
+
+        for(int i = 0; i < comp->tokenCount; i++){
+            if(comp->tokens[i].type == GLOB_STAR){
+                comp->hasStar = 1;
+            } else {
+                comp->minLen++;
+            }
+            if(comp->tokens[i].type != GLOB_CHAR){
+                comp->isPattern = 1;
+            }
+        }
+        for(int i = comp->tokenCount - 1; i >= 0 && comp->tokens[i].type == GLOB_CHAR; i--){
+            comp->tailLen++;
+        }
+
+        p += len;
+        while(*p == '/'){
+            p++;
+        }
+        if(*p == '\0' && end != NULL){
+            trailingSlash = 1;  // e.g. `*/` only matches directories
+        }
+    }
+
+    if(compCount > 0){
+        globWalk(list, comps, compCount, 0, trailingSlash, path, pathLen, 0);
+    }
+    free(tokens);
+    free(comps);
+}
+
+char **expandGlobs(char **argv, struct globList *list){
+    // Pathname expansion for `*`, `?` and `[...]`.
+    // Runs after $$ expansion. Words with no matches are kept
+    // as-is, matches for each word are sorted. Returns a new
+    // NULL-terminated argument vector pointing into `list`,
+    // which the caller frees along with freeGlobList().
+    memset(list, 0, sizeof(*list));
+    for(; *argv != NULL; argv++){
+        size_t start = list->count;
+        if(strpbrk(*argv, "*?[") != NULL){
+            expandGlobWord(list, *argv);
+        }
+        if(list->count == start){
+            globListAppend(list, *argv, strlen(*argv));
+        } else if(list->count - start > 1){
+            globSortArena = list->arena;
+            qsort(list->offsets + start, list->count - start,
+                  sizeof(size_t), compareGlobOffsets);
+        }
+    }
+
+    char **expanded = malloc((list->count + 1) * sizeof(char *));
+    for(size_t i = 0; i < list->count; i++){
+        expanded[i] = list->arena + list->offsets[i];
+    }
+    expanded[list->count] = NULL;
+    return expanded;
+}
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t len){
+    // 64-bit FNV-1a. The length goes in first so that
+    // fields can't run together ("ab","c" vs "a","bc").
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < sizeof(len); i++){
+        hash = (hash ^ ((len >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+    }
+    for(size_t i = 0; i < len; i++){
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void cacheKeyAdd(struct cacheKey *key, const void *data, size_t len){
+    // Appends one field. The length goes in first so that
+    // fields can't run together ("ab","c" vs "a","bc").
+    while(key->len + sizeof(len) + len > key->cap){
+        key->cap = key->cap ? key->cap * 2 : 1024;
+        key->data = realloc(key->data, key->cap);
+    }
+    memcpy(key->data + key->len, &len, sizeof(len));
+    memcpy(key->data + key->len + sizeof(len), data, len);
+    key->len += sizeof(len) + len;
+}
+
+void cacheKeyAddFile(struct cacheKey *key, struct stat *st){
+    // Same inode, size, mtime and ctime == same file, as far as we
+    // care. ctime catches `touch -r` and quick same-size rewrites.
+    cacheKeyAdd(key, &st->st_dev, sizeof(st->st_dev));
+    cacheKeyAdd(key, &st->st_ino, sizeof(st->st_ino));
+    cacheKeyAdd(key, &st->st_size, sizeof(st->st_size));
+    cacheKeyAdd(key, &st->st_mtim, sizeof(st->st_mtim));
+    cacheKeyAdd(key, &st->st_ctim, sizeof(st->st_ctim));
+}
+
+int resolveBinary(char *name, struct stat *st){
+    // Finds the file execvp() would run for `name`.
+    // Returns 0 and fills `st` on success, -1 otherwise.
+    if(strchr(name, '/') != NULL){
+        return stat(name, st);
+    }
+    char *path = getenv("PATH");
+    if(path == NULL){
+        return -1;
+    }
+    char *paths = strdup(path);
+    char *saveptr;
+    char candidate[PATH_MAX];
+    int found = -1;
+    for(char *dir = strtok_r(paths, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)){
+        int len = snprintf(candidate, sizeof(candidate), "%s/%s", dir, name);
+        if(len < 0 || (size_t)len >= sizeof(candidate)){
+            continue;  // Too long to be what execvp() runs either
+        }
+        if(stat(candidate, st) == 0 && S_ISREG(st->st_mode) && access(candidate, X_OK) == 0){
+            found = 0;
+            break;
+        }
+    }
+    free(paths);
+    return found;
+}
+
+int getCacheDirName(char *dir, size_t sizeDir){
+    // Cache lives in $SMALLSH_CACHE_DIR, or ~/.smallsh_cache.
+    // Returns -1 if the name doesn't fit in `dir`.
+    char *configured = getenv("SMALLSH_CACHE_DIR");
+    int len;
+    if(configured != NULL && configured[0] != '\0'){
+        len = snprintf(dir, sizeDir, "%s", configured);
+    } else {
+        char *home = getenv("HOME");
+        len = snprintf(dir, sizeDir, "%s/.smallsh_cache", home ? home : ".");
+    }
+    return (len < 0 || (size_t)len >= sizeDir) ? -1 : 0;
+}
+
+int getCacheDir(char *dir, size_t sizeDir){
+    // Same as getCacheDirName(), but makes sure the directory exists
+    if(getCacheDirName(dir, sizeDir) != 0){
+        return -1;
+    }
+    if(mkdir(dir, 0700) == -1 && errno != EEXIST){
+        perror("Error! Could not create cache directory");
+        fflush(stderr);
+        return -1;
+    }
+    return 0;
+}
+
+int replayCachedOutput(char *cachePath, char *target){
+    // Copies stored output into `target` (or stdout if no `>` was given).
+    // Tries a reflink first, then copy_file_range(), and only falls
+    // back to read()/write() for terminals, pipes and the like.
+    int sourceFD = open(cachePath, O_RDONLY | O_CLOEXEC);
+    if(sourceFD == -1){
+        perror("Error! Could not open cached output");
+        fflush(stderr);
+        return -1;
+    }
+    int targetFD = STDOUT_FILENO;
+    if(strcmp(target, "") != 0){
+        targetFD = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(targetFD == -1){
+            perror("Error! Could not open target file");
+            fflush(stderr);
+            close(sourceFD);
+            return -1;
+        }
+    }
+    fflush(stdout);  // Don't let earlier prompt output land after ours
+
+    struct stat st;
+    fstat(sourceFD, &st);
+    off_t remaining = st.st_size;
+    int result = 0;
+
+#ifdef FICLONE
+    // Only safe on a file we just truncated ourselves
+    if(targetFD != STDOUT_FILENO && ioctl(targetFD, FICLONE, sourceFD) == 0){
+        remaining = 0;
+    }
+#endif
+    while(remaining > 0){
+        ssize_t copied = copy_file_range(sourceFD, NULL, targetFD, NULL, remaining, 0);
+        if(copied == -1 && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP
+           && errno != ENOSYS && errno != EBADF){
+            // A real write error (ENOSPC, EIO...), not just an
+            // unsupported target. EBADF is what an O_APPEND stdout gives.
+            perror("Error! Could not write cached output");
+            fflush(stderr);
+            result = -1;
+            break;
+        }
+        if(copied <= 0){
+            break;  // Not supported for this target, finish the slow way
+        }
+        remaining -= copied;
+    }
+    if(remaining > 0 && result == 0){
+        // Both FDs' offsets have moved past whatever was copied above
+        char chunk[65536];
+        ssize_t nread;
+        while(result == 0 && (nread = read(sourceFD, chunk, sizeof(chunk))) != 0){
+            if(nread == -1){
+                perror("Error! Could not read cached output");
+                fflush(stderr);
+                result = -1;
+                break;
+            }
+            for(ssize_t done = 0; done < nread;){
+                ssize_t nwritten = write(targetFD, chunk + done, nread - done);
+                if(nwritten == -1){
+                    perror("Error! Could not write cached output");
+                    fflush(stderr);
+                    result = -1;
+                    break;
+                }
+                done += nwritten;
+            }
+        }
+    }
+
+    close(sourceFD);
+    if(targetFD != STDOUT_FILENO){
+        close(targetFD);
+    }
+    return result;
+}
+
+struct cacheEntry {
+    char key[32];
+    off_t size;
+    struct timespec lastUsed;  // .out mtime, bumped on every hit
+};
+
+int compareCacheEntries(const void *a, const void *b){
+    // Least recently used first
+    const struct cacheEntry *x = a;
+    const struct cacheEntry *y = b;
+    if(x->lastUsed.tv_sec != y->lastUsed.tv_sec){
+        return x->lastUsed.tv_sec < y->lastUsed.tv_sec ? -1 : 1;
+    }
+    if(x->lastUsed.tv_nsec != y->lastUsed.tv_nsec){
+        return x->lastUsed.tv_nsec < y->lastUsed.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+void evictCache(char *cacheDir){
+    // Drops least recently used entries until everything in the
+    // cache directory fits under $SMALLSH_CACHE_MAX bytes. Temp and
+    // `.status` files left behind by a dead shell count too, and are
+    // removed once they're older than CACHE_TMP_MAX_AGE.
+    long long cap = CACHE_DEFAULT_MAX;
+    char *configured = getenv("SMALLSH_CACHE_MAX");
+    if(configured != NULL && configured[0] != '\0'){
+        char *end;
+        long long parsed = strtoll(configured, &end, 10);
+        if(*end == '\0' && parsed > 0){
+            cap = parsed;  // Anything else (junk, 0, negative) keeps the default
+        }
+    }
+
+    DIR *dir = opendir(cacheDir);
+    if(dir == NULL){
+        return;
+    }
+    time_t now = time(NULL);
+    struct cacheEntry *entries = NULL;
+    size_t count = 0;
+    size_t capEntries = 0;
+    long long total = 0;
+    struct dirent *d;
+    while((d = readdir(dir)) != NULL){
+        char *name = d->d_name;
+        size_t len = strlen(name);
+        struct stat st;
+        if(fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)){
+            continue;
+        }
+        int isStale = (now - st.st_mtime > CACHE_TMP_MAX_AGE);
+
+        if(strstr(name, ".tmp.") != NULL){
+            // Output of a run still in progress, or of one that never finished
+            if(isStale){
+                unlinkat(dirfd(dir), name, 0);
+            } else {
+                total += st.st_size;
+            }
+            continue;
+        }
+
+        char keyName[32];
+        char sibling[64];
+        struct stat siblingSt;
+        if(len > 7 && len - 7 < sizeof(keyName) && strcmp(name + len - 7, ".status") == 0){
+            // Counted along with its `.out` below, unless that's missing
+            memcpy(keyName, name, len - 7);
+            keyName[len - 7] = '\0';
+            snprintf(sibling, sizeof(sibling), "%s.out", keyName);
+            if(fstatat(dirfd(dir), sibling, &siblingSt, 0) == 0){
+                continue;
+            }
+            if(isStale){
+                unlinkat(dirfd(dir), name, 0);
+            } else {
+                total += st.st_size;
+            }
+            continue;
+        }
+
+        if(len < 5 || len - 4 >= sizeof(keyName) || strcmp(name + len - 4, ".out") != 0){
+            continue;
+        }
+        if(count == capEntries){
+            capEntries = capEntries ? capEntries * 2 : 64;
+            entries = realloc(entries, capEntries * sizeof(struct cacheEntry));
+        }
+        memcpy(entries[count].key, name, len - 4);
+        entries[count].key[len - 4] = '\0';
+        entries[count].size = st.st_size;
+        snprintf(sibling, sizeof(sibling), "%s.status", entries[count].key);
+        if(fstatat(dirfd(dir), sibling, &siblingSt, 0) == 0){
+            entries[count].size += siblingSt.st_size;
+        }
+        entries[count].lastUsed = st.st_mtim;
+        total += entries[count].size;
+        count++;
+    }
+
+    if(total > cap){
+        qsort(entries, count, sizeof(struct cacheEntry), compareCacheEntries);
+        char name[64];
+        for(size_t i = 0; i < count && total > cap; i++){
+            snprintf(name, sizeof(name), "%s.out", entries[i].key);
+            unlinkat(dirfd(dir), name, 0);
+            snprintf(name, sizeof(name), "%s.status", entries[i].key);
+            unlinkat(dirfd(dir), name, 0);
+            total -= entries[i].size;
+            cacheEvictions++;
+        }
+    }
+    free(entries);
+    closedir(dir);
+}
+
+int buildCachePath(char *path, size_t sizePath, char *cacheDir, uint64_t key, char *suffix){
+    // `<cacheDir>/<key><suffix>`. Returns -1 rather than
+    // hand back a truncated path that could name another entry.
+    int len = snprintf(path, sizePath, "%s/%016llx%s", cacheDir, (unsigned long long)key, suffix);
+    return (len < 0 || (size_t)len >= sizePath) ? -1 : 0;
+}
+
+int hasStableIdentity(char *path, struct stat *st){
+    // Only regular files on a real filesystem change their
+    // size/mtime/ctime when their contents change. /proc and
+    // /sys files claim to be regular but are generated on read.
+    if(!S_ISREG(st->st_mode)){
+        return 0;
+    }
+    struct statfs fs;
+    if(statfs(path, &fs) != 0){
+        return 0;
+    }
+    return fs.f_type != PROC_SUPER_MAGIC && fs.f_type != SYSFS_MAGIC
+           && fs.f_type != DEBUGFS_MAGIC && fs.f_type != TRACEFS_MAGIC
+           && fs.f_type != CGROUP_SUPER_MAGIC && fs.f_type != CGROUP2_SUPER_MAGIC;
+}
+
+int cacheKeyAddHereDocument(struct cacheKey *key, int hereFD){
+    // Adds a here-document's whole body to the key.
+    // The memfd is sealed, so mapping it gives a stable view.
+    // Returns -1 if the body couldn't be read.
+    struct stat here;
+    if(fstat(hereFD, &here) == -1){
+        return -1;
+    }
+    if(here.st_size == 0){
+        cacheKeyAdd(key, "", 0);
+        return 0;
+    }
+    void *body = mmap(NULL, here.st_size, PROT_READ, MAP_PRIVATE, hereFD, 0);
+    if(body == MAP_FAILED){
+        return -1;
+    }
+    cacheKeyAdd(key, body, here.st_size);
+    munmap(body, here.st_size);
+    return 0;
+}
+
+int readCacheStatus(char *statusPath, struct cacheKey *key, int *status){
+    // A `.status` file is the exit status on its own line followed
+    // by the key it was stored under. Returns 0 (and fills `status`)
+    // only if that key is byte-for-byte the one we're looking up.
+    FILE *statusFile = fopen(statusPath, "r");
+    if(statusFile == NULL){
+        return -1;
+    }
+    int matches = (fscanf(statusFile, "%d", status) == 1 && fgetc(statusFile) == '\n');
+    char chunk[65536];
+    size_t compared = 0;
+    size_t nread;
+    while(matches && (nread = fread(chunk, 1, sizeof(chunk), statusFile)) > 0){
+        if(compared + nread > key->len || memcmp(chunk, key->data + compared, nread) != 0){
+            matches = 0;
+        }
+        compared += nread;
+    }
+    matches = matches && compared == key->len && !ferror(statusFile);
+    fclose(statusFile);
+    return matches ? 0 : -1;
+}
+
+int writeCacheStatus(char *statusPath, struct cacheKey *key, int status){
+    // Counterpart to readCacheStatus(). Returns -1 (leaving
+    // nothing behind) if the file couldn't be written in full.
+    FILE *statusFile = fopen(statusPath, "w");
+    if(statusFile == NULL){
+        return -1;
+    }
+    int ok = fprintf(statusFile, "%d\n", status) > 0
+             && fwrite(key->data, 1, key->len, statusFile) == key->len;
+    if(fclose(statusFile) != 0 || !ok){
+        unlink(statusPath);
+        return -1;
+    }
+    return 0;
+}
+
+void runCachedEntry(char **argv, char **pipes, int hereFD, char *cacheDir, struct cacheKey *key){
+    // Replays the entry for `key` if there is one, otherwise
+    // runs the command and stores its output under `key`.
+    uint64_t hash = hashBytes(0xcbf29ce484222325ULL, key->data, key->len);  // FNV offset basis
+
+    char outPath[PATH_MAX];
+    char statusPath[PATH_MAX];
+    char tmpPath[PATH_MAX];
+    char tmpSuffix[32];
+    snprintf(tmpSuffix, sizeof(tmpSuffix), ".tmp.%d", getpid());
+    if(buildCachePath(outPath, sizeof(outPath), cacheDir, hash, ".out") != 0
+       || buildCachePath(statusPath, sizeof(statusPath), cacheDir, hash, ".status") != 0
+       || buildCachePath(tmpPath, sizeof(tmpPath), cacheDir, hash, tmpSuffix) != 0){
+        // A path that got cut short could name some other entry
+        runProgram(argv, 0, pipes, hereFD);
+        return;
+    }
+
+    int status;
+    if(readCacheStatus(statusPath, key, &status) == 0 && access(outPath, R_OK) == 0){
+        // Hit: replay instead of forking
+        cacheHits++;
+        utimensat(AT_FDCWD, outPath, NULL, 0);  // Mark as recently used
+        if(replayCachedOutput(outPath, pipes[1]) != 0){
+            // Same as a child that couldn't open its target
+            setFailedStatus();
+            return;
+        }
+
+        // Same bookkeeping runProgram() does for a foreground process
+        hasRunForegroundProc = 1;
+        last_exit_status = status;
+        if(last_exit_status == 1){
+            exit_status = 1;
+        }
+        last_signal = -1;
+        return;
+    }
+
+    if(strcmp(pipes[1], "") != 0){
+        // Open the target up front, same as the uncached child does
+        // before exec, so a bad `> out` doesn't run the command at all
+        int targetFD = open(pipes[1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(targetFD == -1){
+            perror("Error! Could not open target file");
+            fflush(stderr);
+            setFailedStatus();
+            return;
+        }
+        close(targetFD);
+    }
+
+    // Miss: run for real with stdout going into the cache
+    cacheMisses++;
+    char *cachePipes[2];
+    cachePipes[0] = (strcmp(pipes[0], "") != 0 || hereFD != -1) ? pipes[0] : "/dev/null";
+    cachePipes[1] = tmpPath;
+    runProgram(argv, 0, cachePipes, hereFD);
+
+    if(last_signal != -1){
+        // Killed by a signal: hand over what it managed
+        // to write, but don't remember it
+        replayCachedOutput(tmpPath, pipes[1]);
+        unlink(tmpPath);
+        return;
+    }
+    int replayed;
+    if(writeCacheStatus(statusPath, key, last_exit_status) == 0){
+        rename(tmpPath, outPath);
+        replayed = replayCachedOutput(outPath, pipes[1]);
+        evictCache(cacheDir);
+    } else {
+        replayed = replayCachedOutput(tmpPath, pipes[1]);
+        unlink(tmpPath);
+    }
+    if(replayed != 0){
+        setFailedStatus();
+    }
+}
+
+void runCached(char **argv, int isBackground, char **pipes, int hereFD){
+    // `cached cmd args... < in > out`
+    // Runs `cmd` once and replays its stdout and exit status for
+    // as long as argv, the binary, the input file, the working
+    // directory and the variables named in $SMALLSH_CACHE_ENV
+    // stay the same. Here-documents are keyed on their contents.
+    // Without `<`, `<<` or `<<<` the command gets /dev/null as
+    // stdin, since whatever the shell's own stdin holds can't be keyed.
+    if(argv[0] == NULL){
+        printf("Usage: cached command [args...] [< input] [> output]\n");
+        fflush(stdout);
+        return;
+    }
+
+    char cacheDir[PATH_MAX];
+    struct stat binary;
+    struct stat input;
+    if(isBackground || resolveBinary(argv[0], &binary) != 0
+       || (strcmp(pipes[0], "") != 0 && (stat(pipes[0], &input) != 0 || !hasStableIdentity(pipes[0], &input)))
+       || getCacheDir(cacheDir, sizeof(cacheDir)) != 0){
+        // Nothing sensible to key on (or nowhere to put it),
+        // so just run it normally and let runProgram() report errors.
+        // Input without a stable identity (devices, FIFOs, /proc)
+        // could change under the same key, so it's never cached.
+        // Background jobs aren't cached since we'd have to wait on them.
+        runProgram(argv, isBackground, pipes, hereFD);
+        return;
+    }
+
+    // Build the key
+    // -----
+    struct cacheKey key = {0};
+    cacheKeyAdd(&key, "smallsh-cache-v2", 16);
+    for(char **arg = argv; *arg != NULL; arg++){
+        cacheKeyAdd(&key, *arg, strlen(*arg));
+    }
+    cacheKeyAddFile(&key, &binary);
+    int canKeyInput = 1;
+    if(hereFD != -1){
+        canKeyInput = (cacheKeyAddHereDocument(&key, hereFD) == 0);
+    } else if(strcmp(pipes[0], "") != 0){
+        cacheKeyAddFile(&key, &input);
+    } else {
+        cacheKeyAdd(&key, "", 0);  // i.e. /dev/null
+    }
+    char cwd[PATH_MAX];
+    if(getcwd(cwd, sizeof(cwd)) != NULL){
+        cacheKeyAdd(&key, cwd, strlen(cwd));
+    }
+    char *envNames = getenv("SMALLSH_CACHE_ENV");
+    char *names = strdup(envNames != NULL ? envNames : CACHE_DEFAULT_ENV);
+    char *saveptr;
+    for(char *name = strtok_r(names, ":", &saveptr); name != NULL; name = strtok_r(NULL, ":", &saveptr)){
+        char *value = getenv(name);
+        cacheKeyAdd(&key, name, strlen(name));
+        // Unset and empty are different
+        if(value != NULL){
+            cacheKeyAdd(&key, value, strlen(value));
+        } else {
+            cacheKeyAdd(&key, "\0", 1);
+        }
+    }
+    free(names);
+    // =====
+
+    if(canKeyInput){
+        runCachedEntry(argv, pipes, hereFD, cacheDir, &key);
+    } else {
+        // A key that misses part of the input could
+        // replay some other command's output
+        runProgram(argv, 0, pipes, hereFD);
+    }
+    free(key.data);
+}
+
+void printCacheStats(){
+    // Counters are for this session only
+    char cacheDir[PATH_MAX];
+    printf("Cache hits: %d, misses: %d, evictions: %d", cacheHits, cacheMisses, cacheEvictions);
+    if(getCacheDirName(cacheDir, sizeof(cacheDir)) == 0){
+        printf(" (%s)", cacheDir);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int hereBufferWrite(struct hereBuffer *hb, const char *data, size_t len){
+    // Appends to the memfd through its mapping, growing
+    // both geometrically when the body outgrows them.
+    if(hb->fd == -1){
+        return -1;
+    }
+    if(hb->len + len > hb->cap){
+        size_t newCap = hb->cap ? hb->cap : 65536;
+        while(newCap < hb->len + len){
+            newCap *= 2;
+        }
+        if(hb->map != NULL){
+            munmap(hb->map, hb->cap);
+            hb->map = NULL;
+        }
+        // Pages already written stay in the memfd, remapping doesn't copy them
+        if(ftruncate(hb->fd, newCap) == -1){
+            perror("Error! Could not grow here-document");
+            fflush(stderr);
+            close(hb->fd);
+            hb->fd = -1;
+            return -1;
+        }
+        hb->map = mmap(NULL, newCap, PROT_READ | PROT_WRITE, MAP_SHARED, hb->fd, 0);
+        if(hb->map == MAP_FAILED){
+            perror("Error! Could not map here-document");
+            fflush(stderr);
+            hb->map = NULL;
+            close(hb->fd);
+            hb->fd = -1;
+            return -1;
+        }
+        hb->cap = newCap;
+    }
+    memcpy(hb->map + hb->len, data, len);
+    hb->len += len;
+    return 0;
+}
+
+void hereBufferWriteExpanded(struct hereBuffer *hb, const char *line, size_t len, pid_t pid){
+    // Same `$$` -> pid replacement as expandVar(), but writes
+    // straight into the here-document instead of a fixed buffer
+    char pid_s[10];
+    int pidLen = sprintf(pid_s, "%d", pid);
+    const char *end = line + len;
+    const char *chunk;
+    while((chunk = memmem(line, end - line, "$$", 2)) != NULL){
+        hereBufferWrite(hb, line, chunk - line);
+        hereBufferWrite(hb, pid_s, pidLen);
+        line = chunk + 2;
+    }
+    hereBufferWrite(hb, line, end - line);
+}
+
+int hereBufferOpen(struct hereBuffer *hb){
+    memset(hb, 0, sizeof(*hb));
+    hb->fd = memfd_create("smallsh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(hb->fd == -1){
+        perror("Error! Could not create here-document");
+        fflush(stderr);
+    }
+    return hb->fd;
+}
+
+int hereBufferFinish(struct hereBuffer *hb){
+    // Unmaps, trims to the real length and seals the memfd so the
+    // child (and `cached`, which hashes it) sees a fixed body.
+    // Returns the FD to use as stdin, or -1 on failure.
+    if(hb->map != NULL){
+        munmap(hb->map, hb->cap);
+    }
+    if(hb->fd == -1){
+        return -1;
+    }
+    if(ftruncate(hb->fd, hb->len) == -1
+       || fcntl(hb->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1){
+        perror("Error! Could not seal here-document");
+        fflush(stderr);
+        close(hb->fd);
+        return -1;
+    }
+    return hb->fd;
+}
+
+int readHereDocument(char *delimiter, pid_t pid){
+    // Reads lines from our own stdin up to `delimiter`,
+    // $$-expanding each one into a memfd.
+    struct hereBuffer hb;
+    hereBufferOpen(&hb);  // On failure we still have to eat the body
+
+    int isInteractive = isatty(STDIN_FILENO);
+    size_t delimiterLen = strlen(delimiter);
+    char *line = NULL;
+    size_t n = 0;
+    ssize_t nchr;
+    while(1){
+        if(isInteractive){
+            printf("> ");  // Continuation prompt
+            fflush(stdout);
+        }
+        if((nchr = getline(&line, &n, stdin)) == -1){
+            clearerr(stdin);  // End of input ends the document too
+            break;
+        }
+        size_t lineLen = nchr;
+        if(lineLen > 0 && line[lineLen-1] == '\n'){
+            lineLen--;
+        }
+        if(lineLen == delimiterLen && memcmp(line, delimiter, lineLen) == 0){
+            break;
+        }
+        hereBufferWriteExpanded(&hb, line, nchr, pid);
+    }
+    free(line);
+    return hereBufferFinish(&hb);
+}
+
+int makeHereString(char *word){
+    // `<<< word` feeds `word` plus a newline. It has
+    // already been $$-expanded with the rest of the line.
+    struct hereBuffer hb;
+    hereBufferOpen(&hb);
+    hereBufferWrite(&hb, word, strlen(word));
+    hereBufferWrite(&hb, "\n", 1);
+    return hereBufferFinish(&hb);
 }
 
 void changeDirectory(char *path){
@@ -638,6 +1786,8 @@ int getInput(){
             changeDirToUserPath(buffer);
         } else if(strcmp(buffer, "status") == 0){
             printStatus();
+        } else if(strcmp(buffer, "cachestats") == 0){
+            printCacheStats();
         } else if(strcmp(buffer, "exit") == 0) {
             // We won't exit here, because we still have
             // to clean up remaining processes
@@ -647,16 +1797,52 @@ int getInput(){
 
             // `pipes` holds input redirection and
             // output redirection.
-            // pipes[0] == input, pipes[1] == output
-            char *pipes[2];
+            // pipes[0] == input, pipes[1] == output,
+            // pipes[2] == here-document delimiter, pipes[3] == here-string
+            char *pipes[4];
             pipes[0] = "";
             pipes[1] = "";
+            pipes[2] = "";
+            pipes[3] = "";
 
             // Parse input and fill argv, pipes
-            parseArguments(buffer, argv, pipes);
+            if(parseArguments(buffer, argv, pipes) == -1){
+                // Syntax error, don't run anything
+                setFailedStatus();
+                free(input);
+                return choice;
+            }
+
+            // Gather `<<` / `<<<` input before anything runs
+            int hereFD = -1;
+            int isHereInput = 1;
+            if(strcmp(pipes[2], "") != 0){
+                hereFD = readHereDocument(pipes[2], getpid());
+            } else if(strcmp(pipes[3], "") != 0){
+                hereFD = makeHereString(pipes[3]);
+            } else {
+                isHereInput = 0;
+            }
+
+            // Expand `*`, `?` and `[...]` into matching filenames
+            struct globList globs;
+            char **expandedArgv = expandGlobs(argv, &globs);
 
             // And then move into running the program
-            runProgram(argv, isBackground, pipes);
+            // (unless the here-document couldn't be made)
+            if(isHereInput && hereFD == -1){
+                setFailedStatus();
+            } else if(expandedArgv[0] != NULL && strcmp(expandedArgv[0], "cached") == 0){
+                runCached(expandedArgv + 1, isBackground, pipes, hereFD);
+            } else {
+                runProgram(expandedArgv, isBackground, pipes, hereFD);
+            }
+
+            if(hereFD != -1){
+                close(hereFD);  // The child has its own copy as stdin
+            }
+            free(expandedArgv);
+            freeGlobList(&globs);
         }
         free(input);  // Release input
         return choice;